@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 
 // My stuff
 #include "basicBitmaps.h"
@@ -41,14 +42,15 @@ unsigned char *bmCreateImageData(BITMAPHEADER *bitmapHeader)
 {
     /*
     Returns a pointer to some image data created off information in the given bitmap header
+    The image data is linear, so give the bitmap it goes in a layout of BM_LAYOUT_LINEAR
     */
 
     unsigned char *imageData = malloc(bitmapHeader->width * bitmapHeader->height * 4);
     // Set all alpha channels to 255
     int offset;
-    for (int row = 0; row < bitmapHeader->width; row++)
+    for (int row = 0; row < bitmapHeader->height; row++)
     {
-        for (int col = 0; col < bitmapHeader->height; col++)
+        for (int col = 0; col < bitmapHeader->width; col++)
         {
             offset = (row * bitmapHeader->width + col) * 4 + 3;
             imageData[offset] = 255;
@@ -77,15 +79,75 @@ BITMAP bmGetBitmap(int width, int height)
     // Pass everything to the bitmap
     bitmap.bitmapHeader = bitmapHeader;
     bitmap.imageData = imageData;
+    bitmap.layout = BM_LAYOUT_LINEAR;
 
     // Give
     return bitmap;
 }
 
+static unsigned int bmGetImageDataSize(BITMAP bitmap)
+{
+    /*
+    Returns the size of the image data in memory, tiled image data is padded out to whole tiles
+    */
+
+    if (bitmap.layout == BM_LAYOUT_TILED)
+        return BM_TILES_ACROSS(bitmap.bitmapHeader.width) * BM_TILES_ACROSS(bitmap.bitmapHeader.height) * BM_TILE_SIZE * BM_TILE_SIZE * 4;
+    return bitmap.bitmapHeader.width * bitmap.bitmapHeader.height * 4;
+}
+
+static void bmCopyRowFromTiles(BITMAP bitmap, int row, unsigned char *output)
+{
+    /*
+    Copies a row of tiled image data into a linear row
+    Each tile holds 64 pixels of the row next to each other, so it is one memcpy per tile
+    */
+
+    int width = bitmap.bitmapHeader.width, count;
+    for (int col = 0; col < width; col += BM_TILE_SIZE)
+    {
+        count = width - col < BM_TILE_SIZE ? width - col : BM_TILE_SIZE;
+        memcpy(output + col * 4, bitmap.imageData + BM_TILED_OFFSET(width, col, row), count * 4);
+    }
+}
+
+static void bmCopyRowToTiles(BITMAP bitmap, int row, const unsigned char *input)
+{
+    /*
+    Copies a linear row into tiled image data, the opposite of bmCopyRowFromTiles
+    */
+
+    int width = bitmap.bitmapHeader.width, count;
+    for (int col = 0; col < width; col += BM_TILE_SIZE)
+    {
+        count = width - col < BM_TILE_SIZE ? width - col : BM_TILE_SIZE;
+        memcpy(bitmap.imageData + BM_TILED_OFFSET(width, col, row), input + col * 4, count * 4);
+    }
+}
+
+static int bmGetLinearCopy(BITMAP bitmap, BITMAP *copy)
+{
+    /*
+    Gives a linear copy of a tiled bitmap, for functions that read the image data in file order
+    Returns 0 on failure
+    */
+
+    *copy = bitmap;
+    copy->layout = BM_LAYOUT_LINEAR;
+    copy->imageData = malloc(bmGetImageDataSize(*copy));
+    if (copy->imageData == NULL)
+        return 0;
+
+    for (int row = 0; row < bitmap.bitmapHeader.height; row++)
+        bmCopyRowFromTiles(bitmap, row, copy->imageData + row * bitmap.bitmapHeader.width * 4);
+    return 1;
+}
+
 int bmWriteToFile(BITMAP bitmap, const char *fileName)
 {
     /*
     Saves the bitmap file with the given file name
+    Tiled image data is put back into rows one at a time as it is written
     Returns 0 on failure
     */
 
@@ -95,7 +157,23 @@ int bmWriteToFile(BITMAP bitmap, const char *fileName)
         return 0;
     }
     fwrite(&bitmap.bitmapHeader, sizeof(bitmap.bitmapHeader), 1, fptr);
-    fwrite(bitmap.imageData, 1, bitmap.bitmapHeader.imageSize, fptr);
+    if (bitmap.layout == BM_LAYOUT_TILED)
+    {
+        unsigned char *rowData = malloc(bitmap.bitmapHeader.width * 4);
+        if (rowData == NULL)
+        {
+            fclose(fptr);
+            return 0;
+        }
+        for (int row = 0; row < bitmap.bitmapHeader.height; row++)
+        {
+            bmCopyRowFromTiles(bitmap, row, rowData);
+            fwrite(rowData, 4, bitmap.bitmapHeader.width, fptr);
+        }
+        free(rowData);
+    }
+    else
+        fwrite(bitmap.imageData, 1, bitmap.bitmapHeader.imageSize, fptr);
     fclose(fptr);
     return 1;
 }
@@ -120,6 +198,7 @@ int bmGetBitmapFromFile(BITMAP *bitmap, const char *fileName)
 
     // Well, now we can copy over the image data
     bitmap->imageData = bmCreateImageData(&bitmap->bitmapHeader);
+    bitmap->layout = BM_LAYOUT_LINEAR;
     fread(bitmap->imageData, 1, bitmap->bitmapHeader.imageSize, fptr);
 
     // Close the file
@@ -128,11 +207,131 @@ int bmGetBitmapFromFile(BITMAP *bitmap, const char *fileName)
     return 1;
 }
 
+int bmReloadBitmapFromFile(BITMAP *bitmap, unsigned int *bufferSize, const char *fileName)
+{
+    /*
+    Reads the bitmap file into the bitmap struct given, reusing its image data when it is big enough
+    bufferSize holds the size of the current image data and is updated if it has to grow
+    Start with NULL image data and a buffer size of 0, then keep calling this to avoid an allocation per file
+    bmSetLayout swaps the image data for one of a different size, so set bufferSize back to 0 after using it
+    Tiled bitmaps are not accepted, put them back to BM_LAYOUT_LINEAR first
+    Returns 0 on a faliure, the image data is kept so it can still be freed
+    */
+
+    if (bitmap->layout == BM_LAYOUT_TILED)
+        return 0;
+
+    FILE *fptr = fopen(fileName, "rb");
+    if (fptr == NULL)
+        return 0;
+
+    // Read and check the header, only uncompressed (or plain bit field) 32 bit files are understood
+    if (fread(&bitmap->bitmapHeader, 1, 54, fptr) != 54 ||
+        *(char *)&bitmap->bitmapHeader.identifier != 'B' || *(((char *)&bitmap->bitmapHeader.identifier) + 1) != 'M' ||
+        bitmap->bitmapHeader.bitsPerPixel != 32 || bitmap->bitmapHeader.width <= 0 || bitmap->bitmapHeader.height <= 0 ||
+        (bitmap->bitmapHeader.compressionMethod != 0 && bitmap->bitmapHeader.compressionMethod != 3))
+    {
+        fclose(fptr);
+        return 0;
+    }
+
+    // Bit fields are only fine if the red, green and blue masks are the usual ones, straight after the 40 byte info header
+    // This is where they are for both the plain info header and the bigger V4 and V5 headers
+    if (bitmap->bitmapHeader.compressionMethod == 3)
+    {
+        unsigned int masks[3];
+        if (fread(masks, 4, 3, fptr) != 3 || masks[0] != 0x00FF0000 || masks[1] != 0x0000FF00 || masks[2] != 0x000000FF)
+        {
+            fclose(fptr);
+            return 0;
+        }
+    }
+
+    // Work the size out without overflowing, the pixel offsets used everywhere else are ints so it has to fit in one
+    unsigned long long fullSize = (unsigned long long)bitmap->bitmapHeader.width * bitmap->bitmapHeader.height * 4;
+    if (fullSize > INT_MAX)
+    {
+        fclose(fptr);
+        return 0;
+    }
+    unsigned int size = fullSize;
+
+    // Grow the buffer if needed
+    if (size > *bufferSize)
+    {
+        unsigned char *imageData = realloc(bitmap->imageData, size);
+        if (imageData == NULL)
+        {
+            fclose(fptr);
+            return 0;
+        }
+        bitmap->imageData = imageData;
+        *bufferSize = size;
+    }
+
+    // Copy over the image data, skipping anything between the header and the pixels
+    bitmap->layout = BM_LAYOUT_LINEAR;
+    fseek(fptr, bitmap->bitmapHeader.offset, SEEK_SET);
+    int success = fread(bitmap->imageData, 1, size, fptr) == size;
+
+    // Make the header describe what bmWriteToFile will write, just the 54 byte header and the pixels
+    bitmap->bitmapHeader.offset = 54;
+    bitmap->bitmapHeader.infoHeaderSize = 40;
+    bitmap->bitmapHeader.compressionMethod = 0;
+    bitmap->bitmapHeader.colourPaletteNumber = 0;
+    bitmap->bitmapHeader.imageSize = size;
+    bitmap->bitmapHeader.bitmapFileSize = size + 54;
+
+    fclose(fptr);
+    return success;
+}
+
 void bmFreeBitmapImageData(BITMAP *bitmap)
 {
     free(bitmap->imageData);
 }
 
+int bmSetLayout(BITMAP *bitmap, char layout)
+{
+    /*
+    Changes how the image data is laid out in memory, the image itself stays the same
+    BM_LAYOUT_LINEAR stores the rows one after another like the file does, this is what every bitmap starts with
+    BM_LAYOUT_TILED stores 64 by 64 pixel tiles one after another, which is kinder to the cache when rotating or going up columns
+    Use BM_PIXEL_OFFSET to find a pixel in the image data of either layout
+    The image data is replaced, so any buffer size kept for bmReloadBitmapFromFile is out of date afterwards
+    Returns 0 on failure, leaving the bitmap as it was
+    */
+
+    if (layout != BM_LAYOUT_LINEAR && layout != BM_LAYOUT_TILED)
+        return 0;
+    // Like BM_PIXEL_OFFSET, anything that is not tiled is treated as linear
+    if ((bitmap->layout == BM_LAYOUT_TILED) == (layout == BM_LAYOUT_TILED))
+    {
+        bitmap->layout = layout;
+        return 1;
+    }
+
+    // Zeroed so the unused part of the tiles along the edges is always the same
+    BITMAP converted = *bitmap;
+    converted.layout = layout;
+    converted.imageData = calloc(bmGetImageDataSize(converted), 1);
+    if (converted.imageData == NULL)
+        return 0;
+
+    int rowSize = bitmap->bitmapHeader.width * 4;
+    for (int row = 0; row < bitmap->bitmapHeader.height; row++)
+    {
+        if (layout == BM_LAYOUT_TILED)
+            bmCopyRowToTiles(converted, row, bitmap->imageData + row * rowSize);
+        else
+            bmCopyRowFromTiles(*bitmap, row, converted.imageData + row * rowSize);
+    }
+
+    free(bitmap->imageData);
+    *bitmap = converted;
+    return 1;
+}
+
 //==============================================================================
 // Retrieving information
 //==============================================================================
@@ -175,19 +374,16 @@ void bmFillImageData(BITMAP bitmap, COLOUR colour)
 {
     /*
     Fills the image data with the given colour
+    Every pixel is written whatever the layout, so the order does not matter
     */
 
-    int offset;
-    for (int row = 0; row < bitmap.bitmapHeader.height; row++)
+    unsigned int size = bmGetImageDataSize(bitmap);
+    for (unsigned int offset = 0; offset < size; offset += 4)
     {
-        for (int col = 0; col < bitmap.bitmapHeader.width; col++)
-        {
-            offset = (row * bitmap.bitmapHeader.width + col) * 4;
-            bitmap.imageData[offset + 0] = colour.blue;
-            bitmap.imageData[offset + 1] = colour.green;
-            bitmap.imageData[offset + 2] = colour.red;
-            bitmap.imageData[offset + 3] = 255;
-        }
+        bitmap.imageData[offset + 0] = colour.blue;
+        bitmap.imageData[offset + 1] = colour.green;
+        bitmap.imageData[offset + 2] = colour.red;
+        bitmap.imageData[offset + 3] = 255;
     }
 }
 
@@ -208,74 +404,98 @@ void bmDrawRectangle(BITMAP bitmap, COLOUR colour, int left, int right, int bott
     if (bottom < 0)
         bottom = 0;
 
-    // Writing to the bitmap
-    int offset;
+    // Writing to the bitmap, tiled image data is done a tile at a time so memory is written in order
+    // For linear image data the whole rectangle is one block
+    int offset, blockTop, blockRight;
+    int tiled = bitmap.layout == BM_LAYOUT_TILED, width = bitmap.bitmapHeader.width;
     if (!flags) // No flags
     {
-        for (int row = bottom; row < top; row++)
+        for (int blockBottom = bottom; blockBottom < top; blockBottom = blockTop)
         {
-            for (int col = left; col < right; col++)
+            blockTop = BM_BLOCK_END(blockBottom, top, tiled);
+            for (int blockLeft = left; blockLeft < right; blockLeft = blockRight)
             {
-                offset = (row * bitmap.bitmapHeader.width + col) * 4;
-                bitmap.imageData[offset + 0] = colour.blue;
-                bitmap.imageData[offset + 1] = colour.green;
-                bitmap.imageData[offset + 2] = colour.red;
+                blockRight = BM_BLOCK_END(blockLeft, right, tiled);
+                for (int row = blockBottom; row < blockTop; row++)
+                {
+                    offset = tiled ? BM_TILED_OFFSET(width, blockLeft, row) : (row * width + blockLeft) * 4;
+                    for (int col = blockLeft; col < blockRight; col++, offset += 4)
+                    {
+                        bitmap.imageData[offset + 0] = colour.blue;
+                        bitmap.imageData[offset + 1] = colour.green;
+                        bitmap.imageData[offset + 2] = colour.red;
+                    }
+                }
             }
         }
     }
     else if (flags & BM_BLEND_RGB_ADD) // Add the rgb values
     {
-        for (int row = bottom; row < top; row++)
+        for (int blockBottom = bottom; blockBottom < top; blockBottom = blockTop)
         {
-            for (int col = left; col < right; col++)
+            blockTop = BM_BLOCK_END(blockBottom, top, tiled);
+            for (int blockLeft = left; blockLeft < right; blockLeft = blockRight)
             {
-                offset = (row * bitmap.bitmapHeader.width + col) * 4;
-
-                // Blue
-                if (bitmap.imageData[offset + 0] + colour.blue > 255)
-                    bitmap.imageData[offset + 0] = 255;
-                else
-                    bitmap.imageData[offset + 0] += colour.blue;
-
-                // Green
-                if (bitmap.imageData[offset + 1] + colour.green > 255)
-                    bitmap.imageData[offset + 1] = 255;
-                else
-                    bitmap.imageData[offset + 1] += colour.green;
-
-                // Red
-                if (bitmap.imageData[offset + 2] + colour.red > 255)
-                    bitmap.imageData[offset + 2] = 255;
-                else
-                    bitmap.imageData[offset + 2] += colour.red;
+                blockRight = BM_BLOCK_END(blockLeft, right, tiled);
+                for (int row = blockBottom; row < blockTop; row++)
+                {
+                    offset = tiled ? BM_TILED_OFFSET(width, blockLeft, row) : (row * width + blockLeft) * 4;
+                    for (int col = blockLeft; col < blockRight; col++, offset += 4)
+                    {
+                        // Blue
+                        if (bitmap.imageData[offset + 0] + colour.blue > 255)
+                            bitmap.imageData[offset + 0] = 255;
+                        else
+                            bitmap.imageData[offset + 0] += colour.blue;
+
+                        // Green
+                        if (bitmap.imageData[offset + 1] + colour.green > 255)
+                            bitmap.imageData[offset + 1] = 255;
+                        else
+                            bitmap.imageData[offset + 1] += colour.green;
+
+                        // Red
+                        if (bitmap.imageData[offset + 2] + colour.red > 255)
+                            bitmap.imageData[offset + 2] = 255;
+                        else
+                            bitmap.imageData[offset + 2] += colour.red;
+                    }
+                }
             }
         }
     }
     else if (flags & BM_BLEND_RGB_SUB) // Subtract the rgb values
     {
-        for (int row = bottom; row < top; row++)
+        for (int blockBottom = bottom; blockBottom < top; blockBottom = blockTop)
         {
-            for (int col = left; col < right; col++)
+            blockTop = BM_BLOCK_END(blockBottom, top, tiled);
+            for (int blockLeft = left; blockLeft < right; blockLeft = blockRight)
             {
-                offset = (row * bitmap.bitmapHeader.width + col) * 4;
-
-                // Blue
-                if (bitmap.imageData[offset + 0] - colour.blue < 0)
-                    bitmap.imageData[offset + 0] = 0;
-                else
-                    bitmap.imageData[offset + 0] -= colour.blue;
-
-                // Green
-                if (bitmap.imageData[offset + 1] - colour.green < 0)
-                    bitmap.imageData[offset + 1] = 0;
-                else
-                    bitmap.imageData[offset + 1] -= colour.green;
-
-                // Red
-                if (bitmap.imageData[offset + 2] - colour.red < 0)
-                    bitmap.imageData[offset + 2] = 0;
-                else
-                    bitmap.imageData[offset + 2] -= colour.red;
+                blockRight = BM_BLOCK_END(blockLeft, right, tiled);
+                for (int row = blockBottom; row < blockTop; row++)
+                {
+                    offset = tiled ? BM_TILED_OFFSET(width, blockLeft, row) : (row * width + blockLeft) * 4;
+                    for (int col = blockLeft; col < blockRight; col++, offset += 4)
+                    {
+                        // Blue
+                        if (bitmap.imageData[offset + 0] - colour.blue < 0)
+                            bitmap.imageData[offset + 0] = 0;
+                        else
+                            bitmap.imageData[offset + 0] -= colour.blue;
+
+                        // Green
+                        if (bitmap.imageData[offset + 1] - colour.green < 0)
+                            bitmap.imageData[offset + 1] = 0;
+                        else
+                            bitmap.imageData[offset + 1] -= colour.green;
+
+                        // Red
+                        if (bitmap.imageData[offset + 2] - colour.red < 0)
+                            bitmap.imageData[offset + 2] = 0;
+                        else
+                            bitmap.imageData[offset + 2] -= colour.red;
+                    }
+                }
             }
         }
     }
@@ -302,101 +522,125 @@ void bmDrawCircle(BITMAP bitmap, COLOUR colour, int x, int y, int radius, char f
     if (bottom < 0)
         bottom = 0;
 
-    // Writing to the bitmap
-    int offset, xDifference, yDifference;
+    // Writing to the bitmap, tiled image data is done a tile at a time so memory is written in order
+    // For linear image data the whole square around the circle is one block
+    int offset, blockTop, blockRight, xDifference, yDifference;
+    int tiled = bitmap.layout == BM_LAYOUT_TILED, width = bitmap.bitmapHeader.width;
     int radiousSquared = radius * radius;
     if (!flags)
     {
-        for (int row = bottom; row < top; row++)
+        for (int blockBottom = bottom; blockBottom < top; blockBottom = blockTop)
         {
-            for (int col = left; col < right; col++)
+            blockTop = BM_BLOCK_END(blockBottom, top, tiled);
+            for (int blockLeft = left; blockLeft < right; blockLeft = blockRight)
             {
-                // Circle equation x^2 + y^2 = r^2
-                xDifference = x - col;
-                xDifference *= xDifference;
-                yDifference = y - row;
-                yDifference *= yDifference;
-
-                if (xDifference + yDifference < radiousSquared)
+                blockRight = BM_BLOCK_END(blockLeft, right, tiled);
+                for (int row = blockBottom; row < blockTop; row++)
                 {
-                    offset = (row * bitmap.bitmapHeader.width + col) * 4;
-                    bitmap.imageData[offset + 0] = colour.blue;
-                    bitmap.imageData[offset + 1] = colour.green;
-                    bitmap.imageData[offset + 2] = colour.red;
+                    offset = tiled ? BM_TILED_OFFSET(width, blockLeft, row) : (row * width + blockLeft) * 4;
+                    for (int col = blockLeft; col < blockRight; col++, offset += 4)
+                    {
+                        // Circle equation x^2 + y^2 = r^2
+                        xDifference = x - col;
+                        xDifference *= xDifference;
+                        yDifference = y - row;
+                        yDifference *= yDifference;
+
+                        if (xDifference + yDifference < radiousSquared)
+                        {
+                            bitmap.imageData[offset + 0] = colour.blue;
+                            bitmap.imageData[offset + 1] = colour.green;
+                            bitmap.imageData[offset + 2] = colour.red;
+                        }
+                    }
                 }
             }
         }
     }
     else if (flags & BM_BLEND_RGB_ADD)
     {
-        for (int row = bottom; row < top; row++)
+        for (int blockBottom = bottom; blockBottom < top; blockBottom = blockTop)
         {
-            for (int col = left; col < right; col++)
+            blockTop = BM_BLOCK_END(blockBottom, top, tiled);
+            for (int blockLeft = left; blockLeft < right; blockLeft = blockRight)
             {
-                // Circle equation x^2 + y^2 = r^2
-                xDifference = x - col;
-                xDifference *= xDifference;
-                yDifference = y - row;
-                yDifference *= yDifference;
-
-                if (xDifference + yDifference < radiousSquared)
+                blockRight = BM_BLOCK_END(blockLeft, right, tiled);
+                for (int row = blockBottom; row < blockTop; row++)
                 {
-                    offset = (row * bitmap.bitmapHeader.width + col) * 4;
-
-                    // Blue
-                    if (bitmap.imageData[offset + 0] + colour.blue > 255)
-                        bitmap.imageData[offset + 0] = 255;
-                    else
-                        bitmap.imageData[offset + 0] += colour.blue;
-
-                    // Green
-                    if (bitmap.imageData[offset + 1] + colour.green > 255)
-                        bitmap.imageData[offset + 1] = 255;
-                    else
-                        bitmap.imageData[offset + 1] += colour.green;
-
-                    // Red
-                    if (bitmap.imageData[offset + 2] + colour.red > 255)
-                        bitmap.imageData[offset + 2] = 255;
-                    else
-                        bitmap.imageData[offset + 2] += colour.red;
+                    offset = tiled ? BM_TILED_OFFSET(width, blockLeft, row) : (row * width + blockLeft) * 4;
+                    for (int col = blockLeft; col < blockRight; col++, offset += 4)
+                    {
+                        // Circle equation x^2 + y^2 = r^2
+                        xDifference = x - col;
+                        xDifference *= xDifference;
+                        yDifference = y - row;
+                        yDifference *= yDifference;
+
+                        if (xDifference + yDifference < radiousSquared)
+                        {
+                            // Blue
+                            if (bitmap.imageData[offset + 0] + colour.blue > 255)
+                                bitmap.imageData[offset + 0] = 255;
+                            else
+                                bitmap.imageData[offset + 0] += colour.blue;
+
+                            // Green
+                            if (bitmap.imageData[offset + 1] + colour.green > 255)
+                                bitmap.imageData[offset + 1] = 255;
+                            else
+                                bitmap.imageData[offset + 1] += colour.green;
+
+                            // Red
+                            if (bitmap.imageData[offset + 2] + colour.red > 255)
+                                bitmap.imageData[offset + 2] = 255;
+                            else
+                                bitmap.imageData[offset + 2] += colour.red;
+                        }
+                    }
                 }
             }
         }
     }
     else if (flags & BM_BLEND_RGB_SUB)
     {
-        for (int row = bottom; row < top; row++)
+        for (int blockBottom = bottom; blockBottom < top; blockBottom = blockTop)
         {
-            for (int col = left; col < right; col++)
+            blockTop = BM_BLOCK_END(blockBottom, top, tiled);
+            for (int blockLeft = left; blockLeft < right; blockLeft = blockRight)
             {
-                // Circle equation x^2 + y^2 = r^2
-                xDifference = x - col;
-                xDifference *= xDifference;
-                yDifference = y - row;
-                yDifference *= yDifference;
-
-                if (xDifference + yDifference < radiousSquared)
+                blockRight = BM_BLOCK_END(blockLeft, right, tiled);
+                for (int row = blockBottom; row < blockTop; row++)
                 {
-                    offset = (row * bitmap.bitmapHeader.width + col) * 4;
-
-                    // Blue
-                    if (bitmap.imageData[offset + 0] - colour.blue < 0)
-                        bitmap.imageData[offset + 0] = 0;
-                    else
-                        bitmap.imageData[offset + 0] -= colour.blue;
-
-                    // Green
-                    if (bitmap.imageData[offset + 1] - colour.green < 0)
-                        bitmap.imageData[offset + 1] = 0;
-                    else
-                        bitmap.imageData[offset + 1] -= colour.green;
-
-                    // Red
-                    if (bitmap.imageData[offset + 2] - colour.red < 0)
-                        bitmap.imageData[offset + 2] = 0;
-                    else
-                        bitmap.imageData[offset + 2] -= colour.red;
+                    offset = tiled ? BM_TILED_OFFSET(width, blockLeft, row) : (row * width + blockLeft) * 4;
+                    for (int col = blockLeft; col < blockRight; col++, offset += 4)
+                    {
+                        // Circle equation x^2 + y^2 = r^2
+                        xDifference = x - col;
+                        xDifference *= xDifference;
+                        yDifference = y - row;
+                        yDifference *= yDifference;
+
+                        if (xDifference + yDifference < radiousSquared)
+                        {
+                            // Blue
+                            if (bitmap.imageData[offset + 0] - colour.blue < 0)
+                                bitmap.imageData[offset + 0] = 0;
+                            else
+                                bitmap.imageData[offset + 0] -= colour.blue;
+
+                            // Green
+                            if (bitmap.imageData[offset + 1] - colour.green < 0)
+                                bitmap.imageData[offset + 1] = 0;
+                            else
+                                bitmap.imageData[offset + 1] -= colour.green;
+
+                            // Red
+                            if (bitmap.imageData[offset + 2] - colour.red < 0)
+                                bitmap.imageData[offset + 2] = 0;
+                            else
+                                bitmap.imageData[offset + 2] -= colour.red;
+                        }
+                    }
                 }
             }
         }
@@ -431,6 +675,7 @@ void bmDrawLine(BITMAP bitmap, COLOUR colour, int startX, int startY, int endX,
 
     // Writing to bitmap
     int offset, row, col;
+    int tiled = bitmap.layout == BM_LAYOUT_TILED, width = bitmap.bitmapHeader.width;
     if (!flags) // No flags
     {
         for (int i = 0; i < numPoints; i++)
@@ -438,7 +683,7 @@ void bmDrawLine(BITMAP bitmap, COLOUR colour, int startX, int startY, int endX,
             col = (int)lerp(startX, endX, (double)i / numPoints);
             row = (int)lerp(startY, endY, (double)i / numPoints);
 
-            offset = (row * bitmap.bitmapHeader.width + col) * 4;
+            offset = tiled ? BM_TILED_OFFSET(width, col, row) : (row * width + col) * 4;
 
             bitmap.imageData[offset + 0] = colour.blue;
             bitmap.imageData[offset + 1] = colour.green;
@@ -452,7 +697,7 @@ void bmDrawLine(BITMAP bitmap, COLOUR colour, int startX, int startY, int endX,
             col = (int)lerp(startX, endX, (double)i / numPoints);
             row = (int)lerp(startY, endY, (double)i / numPoints);
 
-            offset = (row * bitmap.bitmapHeader.width + col) * 4;
+            offset = tiled ? BM_TILED_OFFSET(width, col, row) : (row * width + col) * 4;
 
             // Blue
             if (bitmap.imageData[offset + 0] + colour.blue > 255)
@@ -480,7 +725,7 @@ void bmDrawLine(BITMAP bitmap, COLOUR colour, int startX, int startY, int endX,
             col = (int)lerp(startX, endX, (double)i / numPoints);
             row = (int)lerp(startY, endY, (double)i / numPoints);
 
-            offset = (row * bitmap.bitmapHeader.width + col) * 4;
+            offset = tiled ? BM_TILED_OFFSET(width, col, row) : (row * width + col) * 4;
 
             // Blue
             if (bitmap.imageData[offset + 0] - colour.blue < 0)
@@ -511,13 +756,13 @@ void bmSetColorAt(BITMAP bitmap, COLOUR colour, int x, int y, char flags)
     */
 
     // Constraining to the bitmap size
-    if (x < 0 || x > bitmap.bitmapHeader.width)
+    if (x < 0 || x >= bitmap.bitmapHeader.width)
         return;
-    if (y < 0 || y > bitmap.bitmapHeader.height)
+    if (y < 0 || y >= bitmap.bitmapHeader.height)
         return;
 
     // Writing to bitmap
-    int offset = (y * bitmap.bitmapHeader.width + x) * 4;
+    int offset = BM_PIXEL_OFFSET(bitmap, x, y);
     if (!flags)
     {
         bitmap.imageData[offset + 0] = colour.blue;
@@ -575,11 +820,14 @@ void bmRotateImage(BITMAP bitmap, double xCenter, double yCenter, double angle)
     /*
     Rotates the given bitmap image around the given coordinates by the given angle
     Please note that any part of the image that will be outside of the bitmaps bounds will be cut off
+    Pixels are worked through in 64 by 64 blocks, so the pixels read for each block stay close together
+    This is much quicker on wide images, and quicker again with tiled image data
     */
 
-    // Copy the image data
-    unsigned char *imageCopy = malloc(bitmap.bitmapHeader.imageSize);
-    memcpy(imageCopy, bitmap.imageData, bitmap.bitmapHeader.imageSize);
+    // Copy the image data, in the same layout
+    unsigned int size = bmGetImageDataSize(bitmap);
+    unsigned char *imageCopy = malloc(size);
+    memcpy(imageCopy, bitmap.imageData, size);
 
     // Clear the image data
     bmFillImageData(bitmap, bmGetColour(0, 0, 0));
@@ -616,32 +864,681 @@ void bmRotateImage(BITMAP bitmap, double xCenter, double yCenter, double angle)
     // Necessary variables
     int preRotationCol, preRotationRow;
     int rotatedOffset, preRotationOffset;
-    // For every pixel
-    for (int rotatedRow = 0; rotatedRow < bitmap.bitmapHeader.height; rotatedRow++)
+    int width = bitmap.bitmapHeader.width, height = bitmap.bitmapHeader.height;
+    // For every block
+    for (int blockRow = 0; blockRow < height; blockRow += BM_TILE_SIZE)
+    {
+        for (int blockCol = 0; blockCol < width; blockCol += BM_TILE_SIZE)
+        {
+            // For every pixel in the block
+            for (int rotatedRow = blockRow; rotatedRow < blockRow + BM_TILE_SIZE && rotatedRow < height; rotatedRow++)
+            {
+                for (int rotatedCol = blockCol; rotatedCol < blockCol + BM_TILE_SIZE && rotatedCol < width; rotatedCol++)
+                {
+                    // Rotate the current coords with respect to the center
+                    preRotationCol = cosAngle * (rotatedCol - xCenter) - sinAngle * (rotatedRow - yCenter) + xCenter;
+                    preRotationRow = sinAngle * (rotatedCol - xCenter) + cosAngle * (rotatedRow - yCenter) + yCenter;
+
+                    // Check if within bounds
+                    if (0 <= preRotationCol && preRotationCol < width)
+                    {
+                        if (0 <= preRotationRow && preRotationRow < height)
+                        {
+                            // Calculate offsets
+                            preRotationOffset = BM_PIXEL_OFFSET(bitmap, preRotationCol, preRotationRow);
+                            rotatedOffset = BM_PIXEL_OFFSET(bitmap, rotatedCol, rotatedRow);
+
+                            // Copy data
+                            bitmap.imageData[rotatedOffset + 0] = imageCopy[preRotationOffset + 0];
+                            bitmap.imageData[rotatedOffset + 1] = imageCopy[preRotationOffset + 1];
+                            bitmap.imageData[rotatedOffset + 2] = imageCopy[preRotationOffset + 2];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    free(imageCopy);
+}
+
+//==============================================================================
+// Comparing bitmaps
+//==============================================================================
+
+int bmIsEqual(BITMAP bitmapA, BITMAP bitmapB)
+{
+    /*
+    Checks if two bitmaps are the same size and have exactly the same image data, alpha included
+    Stops at the first difference, returns 1 if they are equal and 0 otherwise
+    */
+
+    if (bitmapA.bitmapHeader.width != bitmapB.bitmapHeader.width || bitmapA.bitmapHeader.height != bitmapB.bitmapHeader.height)
+        return 0;
+
+    // memcmp is already vectorised by the c library and stops at the first differing byte
+    size_t size = (size_t)bitmapA.bitmapHeader.width * bitmapA.bitmapHeader.height * 4;
+    if (bitmapA.layout != BM_LAYOUT_TILED && bitmapB.layout != BM_LAYOUT_TILED)
+        return memcmp(bitmapA.imageData, bitmapB.imageData, size) == 0;
+
+    // With tiled image data compare a row at a time, the edge tiles hold pixels that are not part of the image
+    size_t rowSize = (size_t)bitmapA.bitmapHeader.width * 4;
+    unsigned char *rowA = malloc(rowSize), *rowB = malloc(rowSize);
+    int equal = rowA != NULL && rowB != NULL;
+    for (int row = 0; equal && row < bitmapA.bitmapHeader.height; row++)
+    {
+        if (bitmapA.layout == BM_LAYOUT_TILED)
+            bmCopyRowFromTiles(bitmapA, row, rowA);
+        else
+            memcpy(rowA, bitmapA.imageData + row * rowSize, rowSize);
+
+        if (bitmapB.layout == BM_LAYOUT_TILED)
+            bmCopyRowFromTiles(bitmapB, row, rowB);
+        else
+            memcpy(rowB, bitmapB.imageData + row * rowSize, rowSize);
+
+        equal = memcmp(rowA, rowB, rowSize) == 0;
+    }
+    free(rowA);
+    free(rowB);
+    return equal;
+}
+
+int bmCompare(BITMAP bitmapA, BITMAP bitmapB, unsigned char tolerance, BMCOMPARISON *comparison, BITMAP *diffBitmap)
+{
+    /*
+    Compares the red, green and blue channels of two bitmaps of the same size and fills in the comparison
+    A pixel only counts as different when one of its channels differs by more than the tolerance, use 0 for an exact match
+    If diffBitmap is not NULL it is given a new bitmap holding the absolute difference of each channel, free it when done
+    Identical rows are skipped with a memcmp and the remaining rows are shared between threads when compiled with OpenMP
+    Returns 0 on failure, when the sizes do not match
+    */
+
+    int width = bitmapA.bitmapHeader.width, height = bitmapA.bitmapHeader.height;
+    if (width != bitmapB.bitmapHeader.width || height != bitmapB.bitmapHeader.height)
+        return 0;
+
+    // The comparison works on rows, so compare linear copies of tiled bitmaps
+    if (bitmapA.layout == BM_LAYOUT_TILED || bitmapB.layout == BM_LAYOUT_TILED)
+    {
+        BITMAP linearA = bitmapA, linearB = bitmapB;
+        int success = (bitmapA.layout != BM_LAYOUT_TILED || bmGetLinearCopy(bitmapA, &linearA)) &&
+                      (bitmapB.layout != BM_LAYOUT_TILED || bmGetLinearCopy(bitmapB, &linearB)) &&
+                      bmCompare(linearA, linearB, tolerance, comparison, diffBitmap);
+        if (linearA.imageData != bitmapA.imageData)
+            free(linearA.imageData);
+        if (linearB.imageData != bitmapB.imageData)
+            free(linearB.imageData);
+        return success;
+    }
+
+    // The difference image starts black, so identical rows can be skipped entirely
+    if (diffBitmap != NULL)
+    {
+        *diffBitmap = bmGetBitmap(width, height);
+        bmFillImageData(*diffBitmap, bmGetColour(0, 0, 0));
+    }
+
+    // Running totals, firstDiff is a pixel index and is left one past the end if nothing differs
+    size_t rowSize = (size_t)width * 4;
+    long long pixelCount = (long long)width * height;
+    long long firstDiff = pixelCount;
+    unsigned long long diffPixelCount = 0, squaredErrorSum = 0;
+    unsigned char maxChannelDelta = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 16) reduction(min : firstDiff) reduction(+ : diffPixelCount, squaredErrorSum) reduction(max : maxChannelDelta)
+#endif
+    for (int row = 0; row < height; row++)
+    {
+        unsigned char *rowA = bitmapA.imageData + row * rowSize;
+        unsigned char *rowB = bitmapB.imageData + row * rowSize;
+
+        // Most rows match when regression testing so get rid of them quickly
+        if (memcmp(rowA, rowB, rowSize) == 0)
+            continue;
+
+        unsigned char *rowDiff = diffBitmap != NULL ? diffBitmap->imageData + row * rowSize : NULL;
+        for (int col = 0; col < width; col++)
+        {
+            int offset = col * 4;
+            int blueDelta = abs(rowA[offset + 0] - rowB[offset + 0]);
+            int greenDelta = abs(rowA[offset + 1] - rowB[offset + 1]);
+            int redDelta = abs(rowA[offset + 2] - rowB[offset + 2]);
+
+            squaredErrorSum += blueDelta * blueDelta + greenDelta * greenDelta + redDelta * redDelta;
+
+            // The largest channel difference decides if this pixel differs
+            int pixelDelta = blueDelta;
+            if (greenDelta > pixelDelta)
+                pixelDelta = greenDelta;
+            if (redDelta > pixelDelta)
+                pixelDelta = redDelta;
+
+            if (pixelDelta > maxChannelDelta)
+                maxChannelDelta = pixelDelta;
+
+            if (pixelDelta > tolerance)
+            {
+                diffPixelCount++;
+                if ((long long)row * width + col < firstDiff)
+                    firstDiff = (long long)row * width + col;
+            }
+
+            if (rowDiff != NULL)
+            {
+                rowDiff[offset + 0] = blueDelta;
+                rowDiff[offset + 1] = greenDelta;
+                rowDiff[offset + 2] = redDelta;
+            }
+        }
+    }
+
+    // Fill in the results
+    comparison->equal = diffPixelCount == 0;
+    if (firstDiff < pixelCount)
+    {
+        comparison->firstDiffX = firstDiff % width;
+        comparison->firstDiffY = firstDiff / width;
+    }
+    else
+    {
+        comparison->firstDiffX = -1;
+        comparison->firstDiffY = -1;
+    }
+    comparison->diffPixelCount = diffPixelCount;
+    comparison->maxChannelDelta = maxChannelDelta;
+
+    // Mean squared error over every colour channel, then the peak signal to noise ratio from that
+    comparison->meanSquaredError = pixelCount > 0 ? (double)squaredErrorSum / (pixelCount * 3) : 0;
+    if (comparison->meanSquaredError == 0)
+        comparison->peakSignalToNoiseRatio = INFINITY;
+    else
+        comparison->peakSignalToNoiseRatio = 10 * log10(255.0 * 255.0 / comparison->meanSquaredError);
+
+    return 1;
+}
+
+//==============================================================================
+// Colour palettes and indexed saving
+//==============================================================================
+
+// Macros for the 15 bit colours used to bucket colours when building and looking up palettes
+#define BM_RGB555(red, green, blue) ((((red) >> 3) << 10) | (((green) >> 3) << 5) | ((blue) >> 3))
+#define BM_RGB555_SIZE 32768
+#define BM_PALETTE_HASH_SIZE 512 // Twice the largest palette, keeps the hash set at most half full
+
+typedef struct // A box of 15 bit colours used by the median cut
+{
+    int min[3], max[3]; // The inclusive range of each 5 bit channel, red, green then blue
+    unsigned long long pixelCount;
+} BMCOLOURBOX;
+
+static unsigned int bmPaletteHash(unsigned int colour)
+{
+    // Fibonacci hashing, takes the top 9 bits to index the hash set
+    return (colour * 2654435761u) >> 23;
+}
+
+static int bmGetExactPalette(BITMAP bitmap, COLOUR *palette, unsigned int *hashColours, unsigned char *hashIndices)
+{
+    /*
+    Collects every distinct colour in the bitmap into the palette using a hash set
+    Colours are stored in the hash set plus one, so that 0 can mark an empty slot
+    Returns the number of colours, or -1 as soon as there are more than 256
+    */
+
+    int colourCount = 0;
+    memset(hashColours, 0, BM_PALETTE_HASH_SIZE * sizeof(*hashColours));
+
+    int pixelCount = bitmap.bitmapHeader.width * bitmap.bitmapHeader.height;
+    unsigned int colour, previousColour = 0, slot;
+    for (int i = 0; i < pixelCount; i++)
     {
-        for (int rotatedCol = 0; rotatedCol < bitmap.bitmapHeader.width; rotatedCol++)
+        colour = (bitmap.imageData[i * 4 + 2] << 16 | bitmap.imageData[i * 4 + 1] << 8 | bitmap.imageData[i * 4 + 0]) + 1;
+
+        // Flat colour images repeat the same colour a lot, skip the hash set when that happens
+        if (colour == previousColour)
+            continue;
+        previousColour = colour;
+
+        // Linear probing until the colour or an empty slot is found
+        slot = bmPaletteHash(colour);
+        while (hashColours[slot] != 0 && hashColours[slot] != colour)
+            slot = (slot + 1) & (BM_PALETTE_HASH_SIZE - 1);
+
+        if (hashColours[slot] == 0)
         {
-            // Rotate the current coords with respect to the center
-            preRotationCol = cosAngle * (rotatedCol - xCenter) - sinAngle * (rotatedRow - yCenter) + xCenter;
-            preRotationRow = sinAngle * (rotatedCol - xCenter) + cosAngle * (rotatedRow - yCenter) + yCenter;
+            if (colourCount == 256)
+                return -1;
+
+            hashColours[slot] = colour;
+            hashIndices[slot] = colourCount;
+            palette[colourCount] = bmGetColour(bitmap.imageData[i * 4 + 2], bitmap.imageData[i * 4 + 1], bitmap.imageData[i * 4 + 0]);
+            colourCount++;
+        }
+    }
+    return colourCount;
+}
 
-            // Check if within bounds
-            if (0 <= preRotationCol && preRotationCol < bitmap.bitmapHeader.width)
+static void bmShrinkColourBox(BMCOLOURBOX *box, const unsigned int *histogram)
+{
+    /*
+    Shrinks the box to the smallest one containing all of its used colours and recounts its pixels
+    */
+
+    int min[3] = {31, 31, 31}, max[3] = {0, 0, 0};
+    box->pixelCount = 0;
+    for (int red = box->min[0]; red <= box->max[0]; red++)
+    {
+        for (int green = box->min[1]; green <= box->max[1]; green++)
+        {
+            for (int blue = box->min[2]; blue <= box->max[2]; blue++)
             {
-                if (0 <= preRotationRow && preRotationRow < bitmap.bitmapHeader.width)
+                unsigned int count = histogram[red << 10 | green << 5 | blue];
+                if (count == 0)
+                    continue;
+
+                box->pixelCount += count;
+                int channelValue[3] = {red, green, blue};
+                for (int channel = 0; channel < 3; channel++)
                 {
-                    // Calculate offsets
-                    preRotationOffset = (preRotationRow * bitmap.bitmapHeader.width + preRotationCol) * 4;
-                    rotatedOffset = (rotatedRow * bitmap.bitmapHeader.width + rotatedCol) * 4;
-
-                    // Copy data
-                    bitmap.imageData[rotatedOffset + 0] = imageCopy[preRotationOffset + 0];
-                    bitmap.imageData[rotatedOffset + 1] = imageCopy[preRotationOffset + 1];
-                    bitmap.imageData[rotatedOffset + 2] = imageCopy[preRotationOffset + 2];
+                    if (channelValue[channel] < min[channel])
+                        min[channel] = channelValue[channel];
+                    if (channelValue[channel] > max[channel])
+                        max[channel] = channelValue[channel];
                 }
             }
         }
     }
+
+    if (box->pixelCount > 0)
+    {
+        memcpy(box->min, min, sizeof(min));
+        memcpy(box->max, max, sizeof(max));
+    }
+}
+
+static int bmGetMedianCutPalette(BITMAP bitmap, COLOUR *palette)
+{
+    /*
+    Builds a palette of up to 256 colours with median cut over a 15 bit colour histogram
+    Each palette colour is the average of the full 24 bit colours that landed in its box
+    Returns the number of colours, or -1 if memory could not be allocated
+    */
+
+    unsigned int *histogram = calloc(BM_RGB555_SIZE, sizeof(*histogram));
+    unsigned long long *sums = calloc(BM_RGB555_SIZE * 3, sizeof(*sums));
+    if (histogram == NULL || sums == NULL)
+    {
+        free(histogram);
+        free(sums);
+        return -1;
+    }
+
+    // Fill the histogram, keeping the channel sums of each bucket for the averages later
+    int pixelCount = bitmap.bitmapHeader.width * bitmap.bitmapHeader.height;
+    unsigned char *pixel;
+    int bucket;
+    for (int i = 0; i < pixelCount; i++)
+    {
+        pixel = bitmap.imageData + i * 4;
+        bucket = BM_RGB555(pixel[2], pixel[1], pixel[0]);
+        histogram[bucket]++;
+        sums[bucket * 3 + 0] += pixel[2];
+        sums[bucket * 3 + 1] += pixel[1];
+        sums[bucket * 3 + 2] += pixel[0];
+    }
+
+    // Start with a box around every colour then keep splitting the most populated box
+    BMCOLOURBOX boxes[256];
+    int boxCount = 1;
+    boxes[0] = (BMCOLOURBOX){{0, 0, 0}, {31, 31, 31}, 0};
+    bmShrinkColourBox(&boxes[0], histogram);
+
+    while (boxCount < 256)
+    {
+        // Find the box with the most pixels that still contains more than one bucket
+        int chosen = -1;
+        for (int i = 0; i < boxCount; i++)
+        {
+            if (boxes[i].min[0] == boxes[i].max[0] && boxes[i].min[1] == boxes[i].max[1] && boxes[i].min[2] == boxes[i].max[2])
+                continue;
+            if (chosen == -1 || boxes[i].pixelCount > boxes[chosen].pixelCount)
+                chosen = i;
+        }
+        if (chosen == -1)
+            break;
+
+        // Split along the longest channel
+        BMCOLOURBOX *box = &boxes[chosen];
+        int axis = 0;
+        for (int channel = 1; channel < 3; channel++)
+        {
+            if (box->max[channel] - box->min[channel] > box->max[axis] - box->min[axis])
+                axis = channel;
+        }
+
+        // Count the pixels in each slice along that channel
+        unsigned long long sliceCounts[32] = {0};
+        int channelValue[3];
+        for (channelValue[0] = box->min[0]; channelValue[0] <= box->max[0]; channelValue[0]++)
+        {
+            for (channelValue[1] = box->min[1]; channelValue[1] <= box->max[1]; channelValue[1]++)
+            {
+                for (channelValue[2] = box->min[2]; channelValue[2] <= box->max[2]; channelValue[2]++)
+                {
+                    sliceCounts[channelValue[axis]] += histogram[channelValue[0] << 10 | channelValue[1] << 5 | channelValue[2]];
+                }
+            }
+        }
+
+        // Cut at the median, making sure both halves keep at least one slice
+        unsigned long long runningCount = 0;
+        int cut = box->min[axis];
+        for (; cut < box->max[axis] - 1; cut++)
+        {
+            runningCount += sliceCounts[cut];
+            if (runningCount * 2 >= box->pixelCount)
+                break;
+        }
+
+        BMCOLOURBOX *newBox = &boxes[boxCount++];
+        *newBox = *box;
+        box->max[axis] = cut;
+        newBox->min[axis] = cut + 1;
+        bmShrinkColourBox(box, histogram);
+        bmShrinkColourBox(newBox, histogram);
+    }
+
+    // Average the colours in each box to get the palette
+    for (int i = 0; i < boxCount; i++)
+    {
+        unsigned long long redSum = 0, greenSum = 0, blueSum = 0, count = 0;
+        for (int red = boxes[i].min[0]; red <= boxes[i].max[0]; red++)
+        {
+            for (int green = boxes[i].min[1]; green <= boxes[i].max[1]; green++)
+            {
+                for (int blue = boxes[i].min[2]; blue <= boxes[i].max[2]; blue++)
+                {
+                    bucket = red << 10 | green << 5 | blue;
+                    count += histogram[bucket];
+                    redSum += sums[bucket * 3 + 0];
+                    greenSum += sums[bucket * 3 + 1];
+                    blueSum += sums[bucket * 3 + 2];
+                }
+            }
+        }
+        if (count == 0) // Only happens for an empty image
+            count = 1;
+        palette[i] = bmGetColour((redSum + count / 2) / count, (greenSum + count / 2) / count, (blueSum + count / 2) / count);
+    }
+
+    free(histogram);
+    free(sums);
+    return boxCount;
+}
+
+int bmGetPalette(BITMAP bitmap, COLOUR *palette)
+{
+    /*
+    Fills the given palette, which must have room for 256 colours, with colours representing the bitmap
+    If the bitmap uses 256 colours or fewer the palette holds exactly those, otherwise they are picked by median cut
+    Returns the number of colours in the palette, or 0 on failure
+    */
+
+    // Palettes are built in file order, so use a linear copy of tiled bitmaps
+    if (bitmap.layout == BM_LAYOUT_TILED)
+    {
+        BITMAP linear;
+        if (!bmGetLinearCopy(bitmap, &linear))
+            return 0;
+        int colourCount = bmGetPalette(linear, palette);
+        bmFreeBitmapImageData(&linear);
+        return colourCount;
+    }
+
+    unsigned int hashColours[BM_PALETTE_HASH_SIZE];
+    unsigned char hashIndices[BM_PALETTE_HASH_SIZE];
+    int colourCount = bmGetExactPalette(bitmap, palette, hashColours, hashIndices);
+    if (colourCount == -1)
+        colourCount = bmGetMedianCutPalette(bitmap, palette);
+    if (colourCount == -1)
+        return 0;
+    return colourCount;
+}
+
+static unsigned char bmGetNearestPaletteIndex(const COLOUR *palette, int colourCount, unsigned short *nearestCache, int red, int green, int blue)
+{
+    /*
+    Returns the index of the palette colour closest to the given colour
+    Results are cached per 15 bit colour, 0xFFFF marks a bucket that has not been looked up yet
+    */
+
+    int bucket = BM_RGB555(red, green, blue);
+    if (nearestCache[bucket] != 0xFFFF)
+        return nearestCache[bucket];
+
+    // Compare against the middle of the bucket so every colour in it gets the same answer
+    int bucketRed = (bucket >> 10) << 3 | 4, bucketGreen = ((bucket >> 5) & 31) << 3 | 4, bucketBlue = (bucket & 31) << 3 | 4;
+    int nearest = 0, nearestDistance = -1, distance, redDifference, greenDifference, blueDifference;
+    for (int i = 0; i < colourCount; i++)
+    {
+        redDifference = palette[i].red - bucketRed;
+        greenDifference = palette[i].green - bucketGreen;
+        blueDifference = palette[i].blue - bucketBlue;
+        distance = redDifference * redDifference + greenDifference * greenDifference + blueDifference * blueDifference;
+        if (nearestDistance == -1 || distance < nearestDistance)
+        {
+            nearest = i;
+            nearestDistance = distance;
+        }
+    }
+
+    nearestCache[bucket] = nearest;
+    return nearest;
+}
+
+static unsigned int bmEncodeRLE8Row(const unsigned char *row, int width, unsigned char *output)
+{
+    /*
+    Run length encodes a row of palette indices as described for BI_RLE8, without the end of line marker
+    Runs of the same index are written as a count and the index
+    Anything else of 3 or more indices is written in absolute mode, padded to an even number of bytes
+    Returns the number of bytes written
+    */
+
+    unsigned int size = 0;
+    int col = 0, run, literal;
+    while (col < width)
+    {
+        // Encoded mode, a run of the same index
+        run = 1;
+        while (col + run < width && run < 255 && row[col + run] == row[col])
+            run++;
+        if (run > 1)
+        {
+            output[size++] = run;
+            output[size++] = row[col];
+            col += run;
+            continue;
+        }
+
+        // Absolute mode, carry on until a run of 3 starts as that is cheaper to encode
+        literal = 0;
+        while (col + literal < width && literal < 255)
+        {
+            if (col + literal + 2 < width && row[col + literal] == row[col + literal + 1] && row[col + literal] == row[col + literal + 2])
+                break;
+            literal++;
+        }
+
+        if (literal < 3) // Absolute mode needs at least 3 indices, a count of 1 or 2 is an escape code
+        {
+            for (int i = 0; i < literal; i++)
+            {
+                output[size++] = 1;
+                output[size++] = row[col + i];
+            }
+        }
+        else
+        {
+            output[size++] = 0;
+            output[size++] = literal;
+            memcpy(output + size, row + col, literal);
+            size += literal;
+            if (literal & 1)
+                output[size++] = 0;
+        }
+        col += literal;
+    }
+    return size;
+}
+
+int bmWriteToFileIndexed(BITMAP bitmap, const char *fileName, char flags)
+{
+    /*
+    Saves the bitmap as an 8 bit per pixel file with a colour palette, a quarter of the size of bmWriteToFile or less
+    Images with 256 colours or fewer are saved exactly, otherwise the colours are reduced with median cut
+    The flag BM_INDEXED_DITHER uses ordered dithering when the colours had to be reduced
+    The flag BM_INDEXED_RLE8 run length encodes the image data, which works well for flat colours
+    Returns 0 on failure
+    */
+
+    // Palettes are built in file order, so use a linear copy of tiled bitmaps
+    if (bitmap.layout == BM_LAYOUT_TILED)
+    {
+        BITMAP linear;
+        if (!bmGetLinearCopy(bitmap, &linear))
+            return 0;
+        int success = bmWriteToFileIndexed(linear, fileName, flags);
+        bmFreeBitmapImageData(&linear);
+        return success;
+    }
+
+    int width = bitmap.bitmapHeader.width, height = bitmap.bitmapHeader.height;
+
+    // Find the palette, keeping the hash set around to map the colours of an exact palette
+    COLOUR palette[256];
+    unsigned int hashColours[BM_PALETTE_HASH_SIZE];
+    unsigned char hashIndices[BM_PALETTE_HASH_SIZE];
+    unsigned short *nearestCache = NULL;
+    int colourCount = bmGetExactPalette(bitmap, palette, hashColours, hashIndices);
+    if (colourCount == -1)
+    {
+        colourCount = bmGetMedianCutPalette(bitmap, palette);
+        nearestCache = malloc(BM_RGB555_SIZE * sizeof(*nearestCache));
+        if (colourCount == -1 || nearestCache == NULL)
+        {
+            free(nearestCache);
+            return 0;
+        }
+        memset(nearestCache, 0xFF, BM_RGB555_SIZE * sizeof(*nearestCache));
+    }
+
+    // Each row of an uncompressed 8 bit bitmap is padded to a multiple of 4 bytes
+    int rowSize = (width + 3) & ~3;
+    unsigned char *indices = calloc((size_t)rowSize * height, 1);
+    if (indices == NULL)
+    {
+        free(nearestCache);
+        return 0;
+    }
+
+    // A 4 by 4 Bayer matrix for ordered dithering
+    static const int bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+    // Map every pixel to its palette index
+    unsigned char *pixel;
+    unsigned int colour, slot;
+    int red, green, blue, spread;
+    for (int row = 0; row < height; row++)
+    {
+        for (int col = 0; col < width; col++)
+        {
+            pixel = bitmap.imageData + (row * width + col) * 4;
+            if (nearestCache == NULL) // Exact palette, every colour is in the hash set
+            {
+                colour = (pixel[2] << 16 | pixel[1] << 8 | pixel[0]) + 1;
+                slot = bmPaletteHash(colour);
+                while (hashColours[slot] != colour)
+                    slot = (slot + 1) & (BM_PALETTE_HASH_SIZE - 1);
+                indices[row * rowSize + col] = hashIndices[slot];
+                continue;
+            }
+
+            red = pixel[2];
+            green = pixel[1];
+            blue = pixel[0];
+            if (flags & BM_INDEXED_DITHER)
+            {
+                // Nudge each channel by -15 to 15 depending on where the pixel is in the matrix
+                spread = bayer[row & 3][col & 3] * 2 - 15;
+                red = red + spread < 0 ? 0 : (red + spread > 255 ? 255 : red + spread);
+                green = green + spread < 0 ? 0 : (green + spread > 255 ? 255 : green + spread);
+                blue = blue + spread < 0 ? 0 : (blue + spread > 255 ? 255 : blue + spread);
+            }
+            indices[row * rowSize + col] = bmGetNearestPaletteIndex(palette, colourCount, nearestCache, red, green, blue);
+        }
+    }
+    free(nearestCache);
+
+    // Compress the indices if asked to, in the worst case every index becomes 2 bytes
+    unsigned char *imageData = indices;
+    unsigned int imageSize = rowSize * height;
+    if (flags & BM_INDEXED_RLE8)
+    {
+        imageData = malloc(((size_t)width * 2 + 2) * height + 2);
+        if (imageData == NULL)
+        {
+            free(indices);
+            return 0;
+        }
+
+        imageSize = 0;
+        for (int row = 0; row < height; row++)
+        {
+            imageSize += bmEncodeRLE8Row(indices + row * rowSize, width, imageData + imageSize);
+
+            // End of line, or end of bitmap after the last row
+            imageData[imageSize++] = 0;
+            imageData[imageSize++] = row == height - 1 ? 1 : 0;
+        }
+        free(indices);
+    }
+
+    // Describe the 8 bit image in the header, the palette sits between the header and the image data
+    BITMAPHEADER bitmapHeader;
+    bmHeaderInit(&bitmapHeader, width, height);
+    bitmapHeader.bitsPerPixel = (short)8;
+    bitmapHeader.compressionMethod = flags & BM_INDEXED_RLE8 ? 1 : 0;
+    bitmapHeader.imageSize = imageSize;
+    bitmapHeader.colourPaletteNumber = colourCount;
+    bitmapHeader.offset = 54 + colourCount * 4;
+    bitmapHeader.bitmapFileSize = bitmapHeader.offset + imageSize;
+
+    // Palette entries are stored as blue, green, red and a reserved 0
+    unsigned char paletteData[256 * 4];
+    for (int i = 0; i < colourCount; i++)
+    {
+        paletteData[i * 4 + 0] = palette[i].blue;
+        paletteData[i * 4 + 1] = palette[i].green;
+        paletteData[i * 4 + 2] = palette[i].red;
+        paletteData[i * 4 + 3] = 0;
+    }
+
+    FILE *fptr = fopen(fileName, "wb");
+    if (fptr == NULL)
+    {
+        free(imageData);
+        return 0;
+    }
+    fwrite(&bitmapHeader, sizeof(bitmapHeader), 1, fptr);
+    fwrite(paletteData, 4, colourCount, fptr);
+    fwrite(imageData, 1, imageSize, fptr);
+    fclose(fptr);
+    free(imageData);
+    return 1;
 }
 
 //==============================================================================
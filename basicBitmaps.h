@@ -4,6 +4,29 @@
 #define BM_BLEND_RGB_ADD 1
 #define BM_BLEND_RGB_SUB 2
 
+#define BM_INDEXED_RLE8 1
+#define BM_INDEXED_DITHER 2
+
+#define BM_LAYOUT_LINEAR 0
+#define BM_LAYOUT_TILED 1
+
+#define BM_TILE_SHIFT 6
+#define BM_TILE_SIZE (1 << BM_TILE_SHIFT) // Tiles are 64 by 64 pixels, 16KB each
+
+#define BM_TILES_ACROSS(width) (((width) + BM_TILE_SIZE - 1) >> BM_TILE_SHIFT)
+
+// Where a block of pixels starting at start ends, the next tile edge for tiled image data or just end for linear
+#define BM_BLOCK_END(start, end, tiled) \
+    ((tiled) && ((start) | (BM_TILE_SIZE - 1)) + 1 < (end) ? ((start) | (BM_TILE_SIZE - 1)) + 1 : (end))
+
+// The byte offset of a pixel in tiled image data, tiles go across then up and each one is stored row by row
+#define BM_TILED_OFFSET(width, x, y) \
+    (((((y) >> BM_TILE_SHIFT) * BM_TILES_ACROSS(width) + ((x) >> BM_TILE_SHIFT)) << (2 * BM_TILE_SHIFT) | ((y) & (BM_TILE_SIZE - 1)) << BM_TILE_SHIFT | ((x) & (BM_TILE_SIZE - 1))) * 4)
+
+// The byte offset of a pixel in the image data of a bitmap, whichever layout it uses, anything but BM_LAYOUT_TILED counts as linear
+#define BM_PIXEL_OFFSET(bitmap, x, y) \
+    ((bitmap).layout == BM_LAYOUT_TILED ? BM_TILED_OFFSET((bitmap).bitmapHeader.width, x, y) : ((y) * (bitmap).bitmapHeader.width + (x)) * 4)
+
 #pragma pack(1) // To prevent c from adding padding to the structure below
 typedef struct  // Contains all the necessary information for a bitmap header
 {
@@ -34,6 +57,9 @@ typedef struct // A struct to contain all the information relating to a bitmap
 {
     BITMAPHEADER bitmapHeader;
     unsigned char *imageData;
+    // How the image data is stored, BM_LAYOUT_LINEAR like the file or BM_LAYOUT_TILED, see bmSetLayout
+    // Set by bmGetBitmap and the loading functions, set it to BM_LAYOUT_LINEAR yourself when using bmCreateImageData
+    char layout;
 } BITMAP;
 
 typedef struct // I have no idea what this is used for
@@ -41,6 +67,16 @@ typedef struct // I have no idea what this is used for
     unsigned char red, green, blue; // Hmmmm, incomprehensible...
 } COLOUR;
 
+typedef struct // The results of comparing two bitmaps, filled in by bmCompare
+{
+    int equal;                         // 1 if no pixel differs by more than the tolerance, 0 otherwise
+    int firstDiffX, firstDiffY;        // The first differing pixel, scanning from the start of the image data, -1 if there is none
+    unsigned long long diffPixelCount; // The number of pixels with a channel differing by more than the tolerance
+    unsigned char maxChannelDelta;     // The largest difference seen in any red, green or blue channel
+    double meanSquaredError;           // The mean squared error over the red, green and blue channels
+    double peakSignalToNoiseRatio;     // In decibels, INFINITY when the colour channels are identical
+} BMCOMPARISON;
+
 // Setup and saving of a bitmap and other related things
 void bmHeaderInit(BITMAPHEADER *bitmapHeader, int width, int height);
 unsigned char *bmCreateImageData(BITMAPHEADER *bitmapHeader);
@@ -48,8 +84,10 @@ unsigned char *bmCreateImageData(BITMAPHEADER *bitmapHeader);
 BITMAP bmGetBitmap(int width, int height);
 int bmWriteToFile(BITMAP bitmap, const char *fileName);
 int bmGetBitmapFromFile(BITMAP *bitmap, const char *fileName);
+int bmReloadBitmapFromFile(BITMAP *bitmap, unsigned int *bufferSize, const char *fileName);
 
 void bmFreeBitmapImageData(BITMAP *bitmap);
+int bmSetLayout(BITMAP *bitmap, char layout);
 
 // Retrieving information
 int bmGetWidth(BITMAP bitmap);
@@ -69,6 +107,14 @@ void bmSetColorAt(BITMAP bitmap, COLOUR colour, int x, int y, char flags);
 // More interesting things to do with the bitmaps
 void bmRotateImage(BITMAP bitmap, double xCenter, double yCenter, double angle);
 
+// Comparing bitmaps
+int bmIsEqual(BITMAP bitmapA, BITMAP bitmapB);
+int bmCompare(BITMAP bitmapA, BITMAP bitmapB, unsigned char tolerance, BMCOMPARISON *comparison, BITMAP *diffBitmap);
+
+// Colour palettes and indexed saving
+int bmGetPalette(BITMAP bitmap, COLOUR *palette);
+int bmWriteToFileIndexed(BITMAP bitmap, const char *fileName, char flags);
+
 // Miscellaneous
 COLOUR bmGetColour(unsigned char red, unsigned char green, unsigned char blue);
 
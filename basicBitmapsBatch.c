@@ -0,0 +1,760 @@
+// Including standard headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// My stuff
+#include "basicBitmaps.h"
+
+/*
+Batch processing of bitmap files
+Files are loaded, run through a chain of operations and saved by a three stage pipeline
+Reader, worker and writer threads pass jobs along bounded queues so disk and cpu work overlap
+Every job owns an image buffer that is reused from file to file, so memory is limited to the size of the pool
+
+Build with something like
+    cc -O2 -pthread basicBitmapsBatch.c basicBitmaps.c -lm -o basicBitmapsBatch
+*/
+
+#define BM_BATCH_MAX_OPERATIONS 64
+
+#define BM_BATCH_FORMAT_32 0
+#define BM_BATCH_FORMAT_8 1
+#define BM_BATCH_FORMAT_RLE8 2
+
+//==============================================================================
+// Operations
+//==============================================================================
+
+typedef enum // The operations that can be given on the command line
+{
+    BM_OPERATION_FILL,
+    BM_OPERATION_RECTANGLE,
+    BM_OPERATION_CIRCLE,
+    BM_OPERATION_LINE,
+    BM_OPERATION_ROTATE
+} BMOPERATIONTYPE;
+
+typedef struct // An operation and its arguments
+{
+    BMOPERATIONTYPE type;
+    int values[7];
+    double angle; // Only used for rotating, in radians
+} BMOPERATION;
+
+typedef struct // The name of an operation and how many numbers it takes
+{
+    const char *name;
+    BMOPERATIONTYPE type;
+    int valueCount;
+} BMOPERATIONINFO;
+
+static const BMOPERATIONINFO operationInfo[] = {
+    {"fill", BM_OPERATION_FILL, 3},           // fill:red,green,blue
+    {"rect", BM_OPERATION_RECTANGLE, 7},      // rect:left,right,bottom,top,red,green,blue
+    {"circle", BM_OPERATION_CIRCLE, 6},       // circle:x,y,radius,red,green,blue
+    {"line", BM_OPERATION_LINE, 7},           // line:startX,startY,endX,endY,red,green,blue
+    {"rotate", BM_OPERATION_ROTATE, 1},       // rotate:degrees, around the center of the image
+};
+
+static int bmParseOperation(BMOPERATION *operation, const char *text)
+{
+    /*
+    Parses an operation written as name:value,value,...
+    Returns 0 on failure
+    */
+
+    const char *colon = strchr(text, ':');
+    if (colon == NULL)
+        return 0;
+
+    for (unsigned int i = 0; i < sizeof(operationInfo) / sizeof(operationInfo[0]); i++)
+    {
+        if (strlen(operationInfo[i].name) != (size_t)(colon - text) || strncmp(operationInfo[i].name, text, colon - text) != 0)
+            continue;
+
+        // Read the comma separated numbers, there must be exactly the right amount
+        operation->type = operationInfo[i].type;
+        const char *position = colon + 1;
+        char *end = (char *)position;
+        double value;
+        for (int j = 0; j < operationInfo[i].valueCount; j++)
+        {
+            value = strtod(position, &end);
+            if (end == position || (*end != ',' && *end != '\0') || (*end == '\0' && j != operationInfo[i].valueCount - 1))
+                return 0;
+            operation->values[j] = (int)value;
+            if (operation->type == BM_OPERATION_ROTATE)
+                operation->angle = value * M_PI / 180;
+            position = end + 1;
+        }
+        return *end == '\0';
+    }
+    return 0;
+}
+
+static void bmApplyOperation(BITMAP bitmap, const BMOPERATION *operation)
+{
+    /*
+    Applies a single operation to the bitmap
+    */
+
+    const int *v = operation->values;
+    switch (operation->type)
+    {
+    case BM_OPERATION_FILL:
+        bmFillImageData(bitmap, bmGetColour(v[0], v[1], v[2]));
+        break;
+    case BM_OPERATION_RECTANGLE:
+        bmDrawRectangle(bitmap, bmGetColour(v[4], v[5], v[6]), v[0], v[1], v[2], v[3], 0);
+        break;
+    case BM_OPERATION_CIRCLE:
+        bmDrawCircle(bitmap, bmGetColour(v[3], v[4], v[5]), v[0], v[1], v[2], 0);
+        break;
+    case BM_OPERATION_LINE:
+        bmDrawLine(bitmap, bmGetColour(v[4], v[5], v[6]), v[0], v[1], v[2], v[3], 0);
+        break;
+    case BM_OPERATION_ROTATE:
+        bmRotateImage(bitmap, bmGetImageCenterX(bitmap), bmGetImageCenterY(bitmap), operation->angle);
+        break;
+    }
+}
+
+//==============================================================================
+// Bounded queue
+//==============================================================================
+
+typedef struct // A fixed size ring buffer of pointers, shared between threads
+{
+    void **items;
+    int capacity, head, count;
+    int open; // Cleared once nothing more will be pushed
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty, notFull;
+} BMQUEUE;
+
+static int bmQueueInit(BMQUEUE *queue, int capacity)
+{
+    queue->items = malloc(capacity * sizeof(*queue->items));
+    if (queue->items == NULL)
+        return 0;
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->open = 1;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+    return 1;
+}
+
+static void bmQueueFree(BMQUEUE *queue)
+{
+    free(queue->items);
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+}
+
+static void bmQueuePush(BMQUEUE *queue, void *item)
+{
+    /*
+    Adds an item to the back of the queue, waiting while the queue is full
+    */
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->capacity)
+        pthread_cond_wait(&queue->notFull, &queue->mutex);
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static void *bmQueuePop(BMQUEUE *queue)
+{
+    /*
+    Takes an item from the front of the queue, waiting while the queue is empty
+    Returns NULL once the queue is empty and closed
+    */
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && queue->open)
+        pthread_cond_wait(&queue->notEmpty, &queue->mutex);
+
+    void *item = NULL;
+    if (queue->count > 0)
+    {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->notFull);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+static void bmQueueClose(BMQUEUE *queue)
+{
+    /*
+    Marks the queue as finished, anything waiting on an empty queue is woken up and given NULL
+    */
+
+    pthread_mutex_lock(&queue->mutex);
+    queue->open = 0;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+//==============================================================================
+// The pipeline
+//==============================================================================
+
+typedef struct // A file making its way through the pipeline, and the buffer it is loaded into
+{
+    BITMAP bitmap;
+    unsigned int bufferSize;
+    int input; // Index into the input and output names
+} BMBATCHJOB;
+
+typedef struct // Everything shared by the pipeline threads
+{
+    // Settings
+    const char **inputNames;
+    char **outputNames; // Where each input is saved, worked out before the pipeline starts
+    int inputCount;
+    const char *outputDirectory;
+    BMOPERATION operations[BM_BATCH_MAX_OPERATIONS];
+    int operationCount;
+    int format;
+
+    // Jobs move from the free queue to the process queue, to the write queue and back again
+    BMQUEUE freeQueue, processQueue, writeQueue;
+
+    // Progress, protected by the mutex
+    pthread_mutex_t mutex;
+    int nextInput;
+    int activeReaders, activeWorkers;
+    unsigned long long bytesRead, bytesWritten;
+    int filesWritten, filesFailed;
+} BMBATCH;
+
+static void *bmBatchReader(void *argument)
+{
+    /*
+    Loads files into free jobs and passes them on to the workers
+    */
+
+    BMBATCH *batch = argument;
+    while (1)
+    {
+        // Claim the next file
+        pthread_mutex_lock(&batch->mutex);
+        int input = batch->nextInput < batch->inputCount ? batch->nextInput++ : -1;
+        pthread_mutex_unlock(&batch->mutex);
+        if (input == -1)
+            break;
+
+        // The free queue is only closed when the pipeline is being abandoned
+        BMBATCHJOB *job = bmQueuePop(&batch->freeQueue);
+        if (job == NULL)
+            break;
+
+        job->input = input;
+        const char *inputName = batch->inputNames[input];
+        if (!bmReloadBitmapFromFile(&job->bitmap, &job->bufferSize, inputName))
+        {
+            fprintf(stderr, "Could not read %s\n", inputName);
+            pthread_mutex_lock(&batch->mutex);
+            batch->filesFailed++;
+            pthread_mutex_unlock(&batch->mutex);
+            bmQueuePush(&batch->freeQueue, job);
+            continue;
+        }
+
+        // The header is tidied up when loading, so ask the file system how much was really read
+        struct stat fileStatus;
+        pthread_mutex_lock(&batch->mutex);
+        if (stat(inputName, &fileStatus) == 0)
+            batch->bytesRead += fileStatus.st_size;
+        pthread_mutex_unlock(&batch->mutex);
+        bmQueuePush(&batch->processQueue, job);
+    }
+
+    // The last reader out tells the workers there is nothing more coming
+    pthread_mutex_lock(&batch->mutex);
+    int lastReader = --batch->activeReaders == 0;
+    pthread_mutex_unlock(&batch->mutex);
+    if (lastReader)
+        bmQueueClose(&batch->processQueue);
+    return NULL;
+}
+
+static void *bmBatchWorker(void *argument)
+{
+    /*
+    Runs the chain of operations on loaded jobs and passes them on to the writers
+    */
+
+    BMBATCH *batch = argument;
+    BMBATCHJOB *job;
+    while ((job = bmQueuePop(&batch->processQueue)) != NULL)
+    {
+        for (int i = 0; i < batch->operationCount; i++)
+            bmApplyOperation(job->bitmap, &batch->operations[i]);
+        bmQueuePush(&batch->writeQueue, job);
+    }
+
+    // The last worker out tells the writers there is nothing more coming
+    pthread_mutex_lock(&batch->mutex);
+    int lastWorker = --batch->activeWorkers == 0;
+    pthread_mutex_unlock(&batch->mutex);
+    if (lastWorker)
+        bmQueueClose(&batch->writeQueue);
+    return NULL;
+}
+
+static void bmMakeParentDirectories(const char *path, size_t skip)
+{
+    /*
+    Creates every directory leading up to the file at path, leaving the first skip characters alone
+    Directories that already exist, possibly made by another writer, are fine
+    */
+
+    char *directory = strdup(path);
+    if (directory == NULL)
+        return;
+
+    for (char *slash = strchr(directory + skip, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        mkdir(directory, 0777);
+        *slash = '/';
+    }
+    free(directory);
+}
+
+static int bmBatchSave(BMBATCH *batch, BITMAP bitmap, const char *outputName)
+{
+    /*
+    Saves the bitmap in the chosen format
+    Returns 0 on failure
+    */
+
+    if (batch->format == BM_BATCH_FORMAT_32)
+        return bmWriteToFile(bitmap, outputName);
+    return bmWriteToFileIndexed(bitmap, outputName, batch->format == BM_BATCH_FORMAT_RLE8 ? BM_INDEXED_RLE8 : 0);
+}
+
+static void *bmBatchWriter(void *argument)
+{
+    /*
+    Saves processed jobs to their output names, then returns them to the pool
+    */
+
+    BMBATCH *batch = argument;
+    BMBATCHJOB *job;
+    while ((job = bmQueuePop(&batch->writeQueue)) != NULL)
+    {
+        // Only make directories when saving fails, so it happens about once per directory
+        const char *outputName = batch->outputNames[job->input];
+        int success = bmBatchSave(batch, job->bitmap, outputName);
+        if (!success)
+        {
+            bmMakeParentDirectories(outputName, strlen(batch->outputDirectory) + 1);
+            success = bmBatchSave(batch, job->bitmap, outputName);
+        }
+
+        // The indexed files have no fixed size, so just ask the file system
+        struct stat fileStatus;
+        if (success && stat(outputName, &fileStatus) != 0)
+            success = 0;
+
+        pthread_mutex_lock(&batch->mutex);
+        if (success)
+        {
+            batch->filesWritten++;
+            batch->bytesWritten += fileStatus.st_size;
+        }
+        else
+            batch->filesFailed++;
+        pthread_mutex_unlock(&batch->mutex);
+
+        if (!success)
+            fprintf(stderr, "Could not write %s\n", outputName);
+
+        bmQueuePush(&batch->freeQueue, job);
+    }
+    return NULL;
+}
+
+static void bmBatchAbandon(BMBATCH *batch, int readersNotStarted, int workersNotStarted)
+{
+    /*
+    Winds the pipeline down early when not every thread could be started
+    No more files are claimed, readers waiting for a free job are woken up and given nothing,
+    and the threads that never started are counted as finished so the queues still get closed
+    */
+
+    pthread_mutex_lock(&batch->mutex);
+    batch->nextInput = batch->inputCount;
+    batch->activeReaders -= readersNotStarted;
+    batch->activeWorkers -= workersNotStarted;
+    int closeProcessQueue = batch->activeReaders == 0, closeWriteQueue = batch->activeWorkers == 0;
+    pthread_mutex_unlock(&batch->mutex);
+
+    bmQueueClose(&batch->freeQueue);
+    if (closeProcessQueue)
+        bmQueueClose(&batch->processQueue);
+    if (closeWriteQueue)
+        bmQueueClose(&batch->writeQueue);
+}
+
+//==============================================================================
+// Command line
+//==============================================================================
+
+static void bmPrintUsage(const char *programName)
+{
+    fprintf(stderr,
+            "Usage: %s -o outputDirectory [options] [file.bmp ...]\n"
+            "Reads 32 bit bitmaps, applies the operations in order and saves them under the output directory\n"
+            "Each file keeps its path, so a/b.bmp is saved as outputDirectory/a/b.bmp, and paths with .. are refused\n"
+            "With no files, or a file of -, the file names are read from standard input, one per line\n"
+            "\n"
+            "Options:\n"
+            "  -x operation  Add an operation to the chain, may be given many times\n"
+            "                  fill:red,green,blue\n"
+            "                  rect:left,right,bottom,top,red,green,blue\n"
+            "                  circle:x,y,radius,red,green,blue\n"
+            "                  line:startX,startY,endX,endY,red,green,blue\n"
+            "                  rotate:degrees\n"
+            "  -f format     Output format, 32 (default), 8 or rle8\n"
+            "  -r count      Reader threads (default 2)\n"
+            "  -j count      Worker threads (default the number of cores)\n"
+            "  -w count      Writer threads (default 2)\n"
+            "  -b count      Image buffers in the pool, limits memory use (default the total number of threads plus 2)\n",
+            programName);
+}
+
+static int bmAddInputName(const char ***inputNames, int *inputCount, int *inputCapacity, const char *name)
+{
+    /*
+    Adds a copy of the name to the list of input names, growing it when needed
+    Returns 0 when out of memory, leaving the list as it was
+    */
+
+    if (*inputCount == *inputCapacity)
+    {
+        int capacity = *inputCapacity ? *inputCapacity * 2 : 1024;
+        const char **names = realloc(*inputNames, capacity * sizeof(**inputNames));
+        if (names == NULL)
+            return 0;
+        *inputNames = names;
+        *inputCapacity = capacity;
+    }
+
+    char *copy = strdup(name);
+    if (copy == NULL)
+        return 0;
+    (*inputNames)[(*inputCount)++] = copy;
+    return 1;
+}
+
+static int bmReadInputNames(const char ***inputNames, int *inputCount, int *inputCapacity, FILE *fptr)
+{
+    /*
+    Adds every non empty line of the file to the list of input names
+    Returns 0 on failure
+    */
+
+    char *line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    while ((length = getline(&line, &lineSize, fptr)) != -1)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = '\0';
+        if (length == 0)
+            continue;
+
+        if (!bmAddInputName(inputNames, inputCount, inputCapacity, line))
+        {
+            free(line);
+            return 0;
+        }
+    }
+    free(line);
+    return 1;
+}
+
+static int bmGetOutputName(char **outputName, const char *outputDirectory, const char *inputName)
+{
+    /*
+    Works out where an input is saved, its path is kept under the output directory so files from different folders stay apart
+    Empty and . parts of the path are dropped, so ./a//b.bmp and a/b.bmp both give outputDirectory/a/b.bmp
+    Returns 1 on success, 0 for a path that cannot be kept under the output directory, such as one with .. in it, and -1 when out of memory
+    */
+
+    size_t length = strlen(outputDirectory);
+    *outputName = malloc(length + strlen(inputName) + 2);
+    if (*outputName == NULL)
+        return -1;
+    memcpy(*outputName, outputDirectory, length);
+
+    size_t position = length;
+    const char *part = inputName;
+    while (*part != '\0')
+    {
+        size_t partLength = strcspn(part, "/");
+        if (partLength == 2 && part[0] == '.' && part[1] == '.')
+        {
+            free(*outputName);
+            return 0;
+        }
+        if (partLength > 0 && !(partLength == 1 && part[0] == '.'))
+        {
+            (*outputName)[position++] = '/';
+            memcpy(*outputName + position, part, partLength);
+            position += partLength;
+        }
+        part += partLength;
+        if (*part == '/')
+            part++;
+    }
+    (*outputName)[position] = '\0';
+
+    // Nothing left of the path, or it ended in a slash
+    if (position == length || inputName[strlen(inputName) - 1] == '/')
+    {
+        free(*outputName);
+        return 0;
+    }
+    return 1;
+}
+
+static int bmCompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int bmGetOutputNames(BMBATCH *batch)
+{
+    /*
+    Works out the output name of every input, making sure no two inputs would be saved to the same file
+    Returns 0 on failure, having said why
+    */
+
+    batch->outputNames = calloc(batch->inputCount ? batch->inputCount : 1, sizeof(*batch->outputNames));
+    char **sortedNames = malloc((batch->inputCount ? batch->inputCount : 1) * sizeof(*sortedNames));
+    if (batch->outputNames == NULL || sortedNames == NULL)
+    {
+        fprintf(stderr, "Out of memory working out the output names\n");
+        free(sortedNames);
+        return 0;
+    }
+
+    for (int i = 0; i < batch->inputCount; i++)
+    {
+        int result = bmGetOutputName(&batch->outputNames[i], batch->outputDirectory, batch->inputNames[i]);
+        if (result != 1)
+        {
+            batch->outputNames[i] = NULL;
+            if (result == 0)
+                fprintf(stderr, "Cannot save %s under the output directory\n", batch->inputNames[i]);
+            else
+                fprintf(stderr, "Out of memory working out the output names\n");
+            free(sortedNames);
+            return 0;
+        }
+        sortedNames[i] = batch->outputNames[i];
+    }
+
+    // Any two inputs with the same output name end up next to each other once sorted
+    qsort(sortedNames, batch->inputCount, sizeof(*sortedNames), bmCompareNames);
+    for (int i = 1; i < batch->inputCount; i++)
+    {
+        if (strcmp(sortedNames[i - 1], sortedNames[i]) == 0)
+        {
+            fprintf(stderr, "More than one input would be saved as %s\n", sortedNames[i]);
+            free(sortedNames);
+            return 0;
+        }
+    }
+    free(sortedNames);
+    return 1;
+}
+
+static double bmGetSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    BMBATCH batch;
+    memset(&batch, 0, sizeof(batch));
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int readerCount = 2, workerCount = cores > 0 ? cores : 1, writerCount = 2, bufferCount = 0;
+
+    // Read the options
+    int option;
+    while ((option = getopt(argc, argv, "o:x:f:r:j:w:b:h")) != -1)
+    {
+        switch (option)
+        {
+        case 'o':
+            batch.outputDirectory = optarg;
+            break;
+        case 'x':
+            if (batch.operationCount == BM_BATCH_MAX_OPERATIONS || !bmParseOperation(&batch.operations[batch.operationCount], optarg))
+            {
+                fprintf(stderr, "Bad operation %s\n", optarg);
+                return 1;
+            }
+            batch.operationCount++;
+            break;
+        case 'f':
+            if (strcmp(optarg, "32") == 0)
+                batch.format = BM_BATCH_FORMAT_32;
+            else if (strcmp(optarg, "8") == 0)
+                batch.format = BM_BATCH_FORMAT_8;
+            else if (strcmp(optarg, "rle8") == 0)
+                batch.format = BM_BATCH_FORMAT_RLE8;
+            else
+            {
+                fprintf(stderr, "Bad format %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'r':
+            readerCount = atoi(optarg);
+            break;
+        case 'j':
+            workerCount = atoi(optarg);
+            break;
+        case 'w':
+            writerCount = atoi(optarg);
+            break;
+        case 'b':
+            bufferCount = atoi(optarg);
+            break;
+        default:
+            bmPrintUsage(argv[0]);
+            return option == 'h' ? 0 : 1;
+        }
+    }
+
+    if (batch.outputDirectory == NULL || readerCount < 1 || workerCount < 1 || writerCount < 1 || bufferCount < 0)
+    {
+        bmPrintUsage(argv[0]);
+        return 1;
+    }
+    if (bufferCount == 0)
+        bufferCount = readerCount + workerCount + writerCount + 2;
+
+    // Gather the input file names
+    int inputCapacity = 0;
+    int readStandardInput = optind == argc;
+    for (int i = optind; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-") == 0)
+        {
+            readStandardInput = 1;
+            continue;
+        }
+        if (!bmAddInputName(&batch.inputNames, &batch.inputCount, &inputCapacity, argv[i]))
+        {
+            fprintf(stderr, "Out of memory reading file names\n");
+            return 1;
+        }
+    }
+    if (readStandardInput && !bmReadInputNames(&batch.inputNames, &batch.inputCount, &inputCapacity, stdin))
+    {
+        fprintf(stderr, "Out of memory reading file names\n");
+        return 1;
+    }
+    if (!bmGetOutputNames(&batch))
+        return 1;
+
+    // Set up the queues, each can hold every job so only the pool limits how much is in flight
+    BMBATCHJOB *jobs = calloc(bufferCount, sizeof(*jobs));
+    if (jobs == NULL || !bmQueueInit(&batch.freeQueue, bufferCount) || !bmQueueInit(&batch.processQueue, bufferCount) || !bmQueueInit(&batch.writeQueue, bufferCount))
+    {
+        fprintf(stderr, "Out of memory setting up the pipeline\n");
+        return 1;
+    }
+    for (int i = 0; i < bufferCount; i++)
+        bmQueuePush(&batch.freeQueue, &jobs[i]);
+
+    pthread_mutex_init(&batch.mutex, NULL);
+    batch.activeReaders = readerCount;
+    batch.activeWorkers = workerCount;
+
+    // Run the pipeline
+    double startTime = bmGetSeconds();
+
+    int threadCount = readerCount + workerCount + writerCount;
+    pthread_t *threads = malloc(threadCount * sizeof(*threads));
+    if (threads == NULL)
+    {
+        fprintf(stderr, "Out of memory setting up the pipeline\n");
+        return 1;
+    }
+
+    // If a thread cannot be started, wind down the ones that were before giving up
+    int threadsStarted = 0;
+    for (; threadsStarted < threadCount; threadsStarted++)
+    {
+        int i = threadsStarted;
+        void *(*function)(void *) = i < readerCount ? bmBatchReader : (i < readerCount + workerCount ? bmBatchWorker : bmBatchWriter);
+        if (pthread_create(&threads[i], NULL, function, &batch) != 0)
+        {
+            fprintf(stderr, "Could not start a thread\n");
+            int readersStarted = i < readerCount ? i : readerCount;
+            int workersStarted = i < readerCount ? 0 : (i < readerCount + workerCount ? i - readerCount : workerCount);
+            bmBatchAbandon(&batch, readerCount - readersStarted, workerCount - workersStarted);
+            break;
+        }
+    }
+    for (int i = 0; i < threadsStarted; i++)
+        pthread_join(threads[i], NULL);
+
+    double elapsed = bmGetSeconds() - startTime;
+
+    // Report the throughput
+    if (elapsed <= 0)
+        elapsed = 1e-9;
+    fprintf(stderr, "%d files written, %d failed in %.3f s\n", batch.filesWritten, batch.filesFailed, elapsed);
+    fprintf(stderr, "%.1f files/s, %.1f MB/s read, %.1f MB/s written\n", batch.filesWritten / elapsed,
+            batch.bytesRead / elapsed / 1e6, batch.bytesWritten / elapsed / 1e6);
+
+    // Clean up
+    for (int i = 0; i < bufferCount; i++)
+        bmFreeBitmapImageData(&jobs[i].bitmap);
+    for (int i = 0; i < batch.inputCount; i++)
+    {
+        free((char *)batch.inputNames[i]);
+        free(batch.outputNames[i]);
+    }
+    free(batch.inputNames);
+    free(batch.outputNames);
+    free(jobs);
+    free(threads);
+    bmQueueFree(&batch.freeQueue);
+    bmQueueFree(&batch.processQueue);
+    bmQueueFree(&batch.writeQueue);
+    pthread_mutex_destroy(&batch.mutex);
+
+    return batch.filesFailed > 0 || threadsStarted < threadCount;
+}
+
+// By Seven